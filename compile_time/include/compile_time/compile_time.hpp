@@ -66,25 +66,14 @@ namespace compile_time
         return sum;
     }
 
-    // count how many bits b2 has set on left of b1
-    /// @brief counts the number of differing bits in *b2* that are to
-    /// the left of *b1*
-    /// @param b1 bitmask for the base mask (to be compared to)
-    /// @param b2 bitmask for the comparrison mask (the differing bits)
-    /// @return the number of differing bits in b2 on the left of b1.
-    constexpr std::size_t bits_to_left(std::size_t b1, std::size_t b2)
+    /// @brief Counts the number of bits set in *bitmask* that are
+    /// below (to the right of) the lowest bit set in *bit*
+    /// @param bitmask the integer representing the bitset
+    /// @param bit the single bit to compare against
+    /// @return the number of bits set in bitmask below bit
+    constexpr std::size_t bits_below(std::size_t bitmask, std::size_t bit)
     {
-        std::size_t count = 0;
-        for (int i = std::numeric_limits<std::size_t>::digits - 1; i >= 0; --i)
-        {
-            auto const b2_mask = (b2 >> i);
-            if (b1 >> i)
-            {
-                return count;
-            }
-            count += (b2_mask & 1) ? 1 : 0;
-        }
-        return count;
+        return count_bits_set(bitmask & ((bit & (~bit + 1)) - 1));
     }
 }
 
@@ -63,8 +63,9 @@ namespace
 }
 
 
-// TODO mutex to protect memory
-bool draw(maecs::Registry<Circle, Rect, Position, Colour>& registry)
+// Reads from the last published snapshot, so the simulation
+// can keep modifying the registry while we draw
+bool draw(maecs::SnapshotReader<Circle, Rect, Position, Colour>& reader)
 {
     InitWindow(512, 512, "6502 Graphics");
     while (!WindowShouldClose())
@@ -75,25 +76,18 @@ bool draw(maecs::Registry<Circle, Rect, Position, Colour>& registry)
 
         // We're going to get all the entities with circles
         // and draw these circles on the screen
-        auto const my_colour_id = registry.id<Colour>();
-        auto const my_circle_id = registry.id<Circle>();
-        // registry.get is deprecated
-        
-        // TODO : newest get should support some sort of const correctness
-        // auto const entities_with_circle = registry.newest_get<Circle, Colour>();
-
-        auto entities_with_circle = registry.newest_get<Circle, Colour>();
-
-        //void DrawCircle(int centerX, int centerY, float radius, Color color);
-        
-        auto const& drawable_circle_entities = registry.newest_get<Circle, Position, Colour>();
-        for (auto const& entity_view : *drawable_circle_entities)
+        auto const& snapshot = reader.latest();
+        for (auto const& chunk : snapshot.query<maecs::With<Circle, Position>, maecs::Optional<Colour>>())
         {
-            // Firstly get the 
-            // auto const& circle_component = registry.entity_component<Circle>(component_tuple);
-            // auto const& position_component = registry.entity_component<Position>(component_tuple);
-            // auto const& colour_component = registry.entity_component<Colour>(component_tuple);
-            // DrawCircle(circle_component.center_x, circle_component.center_y, circle_component.radius, colour_table[colour_component.id]);
+            // Colour is either there for the whole chunk or not at all
+            bool const has_colour = chunk.has<Colour>();
+            for (std::size_t i = 0; i < chunk.size(); ++i)
+            {
+                auto const& circle_component = chunk.component<Circle>(i);
+                auto const& position_component = chunk.component<Position>(i);
+                auto const colour = has_colour ? colour_table[chunk.component<Colour>(i).id] : colour_table[1];
+                DrawCircle(position_component.x + circle_component.center_x, position_component.y + circle_component.center_y, circle_component.radius, colour);
+            }
         }
 
         EndDrawing();
@@ -150,6 +144,30 @@ int main(/*int argc, char** argv*/)
     };
 
     // TODO : We need some tests to get the stuff here
+    auto const circle_entity = maecs::generate_entity_id();
+    my_registry.newest_set(circle_entity, my_circle);
+    my_registry.newest_set(circle_entity, my_position);
+    my_registry.newest_set(circle_entity, Colour{.id = 5});
 
-    draw(my_registry);
+    auto reader = my_registry.enable_snapshots();
+    my_registry.publish_snapshot();
+
+    // Simulation runs on its own thread, publishing a snapshot every step
+    std::jthread simulation{[&my_registry](std::stop_token stop) {
+        while (!stop.stop_requested())
+        {
+            for (auto const& chunk : my_registry.query<maecs::With<Position>>())
+            {
+                for (std::size_t i = 0; i < chunk.size(); ++i)
+                {
+                    auto& position = chunk.component<Position>(i);
+                    position.x = (position.x + 1) % 512;
+                }
+            }
+            my_registry.publish_snapshot();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1000 / 60));
+        }
+    }};
+
+    draw(reader);
 }
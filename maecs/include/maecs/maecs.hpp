@@ -6,9 +6,16 @@
 #include <compile_time/compile_time.hpp>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <memory>
 #include <optional>
 #include <span>
+#include <type_traits>
+#include <typeindex>
 #include <typeinfo>
 #include <utility>
 #include <variant>
@@ -17,6 +24,7 @@
 namespace maecs
 {
     using EntityId = std::uint64_t;
+    using PrefabId = std::size_t;
     using Bitmask = std::uint64_t;
     using ComponentId = decltype(std::declval<std::type_info>().hash_code());
     using ComponentName = decltype(std::declval<std::type_info>().name());
@@ -117,6 +125,59 @@ namespace maecs
 
             entity_components[ent_bitmask].push_back({ent_id, component_data});
         }
+
+        /// @brief Wait-free triple buffer for one writer and one reader thread.
+        /// The writer fills back() and publishes it, the reader acquires the
+        /// latest published slot. Neither side ever blocks the other.
+        template <typename T>
+        class TripleBuffer
+        {
+        public:
+            /// @brief The slot owned by the writer thread
+            T& back()
+            {
+                return _slots[_back];
+            }
+
+            /// @brief Hands back() over to the reader, called by the writer thread
+            void publish()
+            {
+                _back = _middle.exchange(_back | fresh_bit, std::memory_order_acq_rel) & index_mask;
+            }
+
+            /// @brief Gets the latest published slot, called by the reader thread.
+            /// The slot is not touched by the writer until the next acquire().
+            T const& acquire()
+            {
+                if (_middle.load(std::memory_order_relaxed) & fresh_bit)
+                {
+                    _front = _middle.exchange(_front, std::memory_order_acq_rel) & index_mask;
+                }
+                return _slots[_front];
+            }
+
+        private:
+            static constexpr std::uint8_t index_mask = 0b011;
+            static constexpr std::uint8_t fresh_bit = 0b100;
+
+            std::array<T, 3> _slots;
+            std::uint8_t _back = 0;
+            std::atomic<std::uint8_t> _middle = 1;
+            std::uint8_t _front = 2;
+        };
+
+        /// @brief Removes the *count* elements of an entity starting at *row*,
+        /// filling the gap with the last entity in the vector
+        template <typename Row>
+        void remove_entity_row(std::vector<Row>& rows, typename std::vector<Row>::iterator row, std::size_t count)
+        {
+            auto const last_row = end(rows) - count;
+            if (row != last_row)
+            {
+                std::move(last_row, end(rows), row);
+            }
+            rows.erase(last_row, end(rows));
+        }
     }
 
 } // maecs
@@ -132,6 +193,16 @@ namespace maecs {
     using Component = std::variant<Cs...>;
     // std::variant<Square, Circle> -> Square has id 0, Circle has id 1
 
+    /// @brief One component of an entity, as stored in the archetype vectors.
+    /// This is a plain struct rather than std::pair so that, when all the
+    /// components are trivially copyable, so are the entity rows.
+    template <typename... Cs>
+    struct EntityComponentPair
+    {
+        EntityId first;
+        std::variant<Cs...> second;
+    };
+
     /* TODO : Let's encode the type returned here*/
     // Shoudl probably move this to "compile_time"
     template <typename... Types>
@@ -148,7 +219,7 @@ namespace maecs {
     {
     public:
         using variant_type = std::variant<Cs...>;
-        EntityView(std::span<std::pair<EntityId, variant_type>> data)
+        EntityView(std::span<EntityComponentPair<Cs...>> data)
             : _data{data}
         {
         }
@@ -157,7 +228,9 @@ namespace maecs {
         template<typename C>
         C component() const
         {
-            constexpr auto position = compile_time::IndexOf<C, Ds...>::index();
+            // Components are laid out in the order of their bits in the
+            // archetype bitmask, not in the order of the Ds... pack
+            constexpr auto position = compile_time::bits_below(ds_bitmask, 1ul << compile_time::IndexOf<C, Cs...>::index());
             return std::get<C>(_data[position].second);
         }
 
@@ -169,7 +242,280 @@ namespace maecs {
         }
 
     private:
-        std::span<std::pair<EntityId, std::variant<Cs...>>> _data;
+        static constexpr Bitmask ds_bitmask = ((1ul << compile_time::IndexOf<Ds, Cs...>::index()) | ...);
+
+        std::span<EntityComponentPair<Cs...>> _data;
+    };
+
+    template <typename... Cs>
+    class Registry;
+
+    template <typename... Cs>
+    class Snapshot;
+
+    /**************************************************
+     * Query filter terms, to be used with
+     * Registry::query<Filters...>()
+    **************************************************/
+    /// @brief Entities must have all of these components
+    template <typename Head, typename... Tail>
+    struct With
+    {
+    };
+
+    /// @brief Entities must have none of these components
+    template <typename Head, typename... Tail>
+    struct Without
+    {
+    };
+
+    /// @brief Entities may have these components, they are
+    /// returned as nullable pointers
+    template <typename Head, typename... Tail>
+    struct Optional
+    {
+    };
+
+    /// @brief Entities must have at least one of these components,
+    /// they are returned as nullable pointers
+    template <typename Head, typename... Tail>
+    struct AnyOf
+    {
+    };
+
+    namespace detail
+    {
+        /// @brief Turns a single filter term into its include, exclude,
+        /// any-of and optional bitmasks for the registry Reg
+        template <typename Reg, typename Filter>
+        struct QueryFilter;
+
+        template <typename Reg, typename... Ts>
+        struct QueryFilter<Reg, With<Ts...>>
+        {
+            static constexpr Bitmask include = Reg::template bit_mask<Ts...>();
+            static constexpr Bitmask exclude = 0;
+            static constexpr Bitmask any = 0;
+            static constexpr Bitmask optional = 0;
+        };
+
+        template <typename Reg, typename... Ts>
+        struct QueryFilter<Reg, Without<Ts...>>
+        {
+            static constexpr Bitmask include = 0;
+            static constexpr Bitmask exclude = Reg::template bit_mask<Ts...>();
+            static constexpr Bitmask any = 0;
+            static constexpr Bitmask optional = 0;
+        };
+
+        template <typename Reg, typename... Ts>
+        struct QueryFilter<Reg, Optional<Ts...>>
+        {
+            static constexpr Bitmask include = 0;
+            static constexpr Bitmask exclude = 0;
+            static constexpr Bitmask any = 0;
+            static constexpr Bitmask optional = Reg::template bit_mask<Ts...>();
+        };
+
+        template <typename Reg, typename... Ts>
+        struct QueryFilter<Reg, AnyOf<Ts...>>
+        {
+            static constexpr Bitmask include = 0;
+            static constexpr Bitmask exclude = 0;
+            static constexpr Bitmask any = Reg::template bit_mask<Ts...>();
+            static constexpr Bitmask optional = Reg::template bit_mask<Ts...>();
+        };
+
+        /// @brief The compiled form of a query, all the filter terms
+        /// folded into the masks each archetype is tested against
+        template <typename Reg, typename... Fs>
+        struct QueryMasks
+        {
+            static constexpr Bitmask include = (QueryFilter<Reg, Fs>::include | ... | 0);
+            static constexpr Bitmask exclude = (QueryFilter<Reg, Fs>::exclude | ... | 0);
+            static constexpr Bitmask optional = (QueryFilter<Reg, Fs>::optional | ... | 0);
+
+            static_assert((include & exclude) == 0, "A component cannot be both required and excluded");
+
+            static constexpr bool matches(Bitmask archetype)
+            {
+                return ((archetype & include) == include)
+                    && ((archetype & exclude) == 0)
+                    && ((QueryFilter<Reg, Fs>::any == 0 || (archetype & QueryFilter<Reg, Fs>::any) != 0) && ...);
+            }
+        };
+    }
+
+    // Disable this if not through our TupleTypes
+    template <typename... Types>
+    class QueryChunk;
+
+    /// @brief View over the entities of one archetype matched by a query.
+    /// The position of every component in the entity rows is worked out
+    /// once for the archetype, so optional components cost no lookups
+    /// per entity. Row is const qualified for read-only views (snapshots).
+    template <typename... Cs, typename... Fs, typename Row>
+    class QueryChunk<TupleTypes<Cs...>, TupleTypes<Fs...>, Row>
+    {
+    public:
+        using variant_type = std::variant<Cs...>;
+        using masks = detail::QueryMasks<Registry<Cs...>, Fs...>;
+        static constexpr std::ptrdiff_t absent = -1;
+
+        QueryChunk(std::span<Row> data, Bitmask archetype)
+            : _data{data}
+            , _archetype{archetype}
+            , _stride{compile_time::count_bits_set(archetype)}
+        {
+            for (std::size_t i = 0; i < sizeof...(Cs); ++i)
+            {
+                Bitmask const bit = 1ul << i;
+                _offsets[i] = (archetype & bit) ? static_cast<std::ptrdiff_t>(compile_time::bits_below(archetype, bit)) : absent;
+            }
+        }
+
+        /// @brief number of entities in this chunk
+        std::size_t size() const
+        {
+            return _data.size() / _stride;
+        }
+
+        Bitmask archetype() const
+        {
+            return _archetype;
+        }
+
+        EntityId id(std::size_t entity) const
+        {
+            return _data[entity * _stride].first;
+        }
+
+        /// @brief Whether the entities in this chunk have the component,
+        /// always true for the components required by the query (With<...>).
+        /// The same for every entity, so check it once per chunk.
+        template <typename C>
+        bool has() const
+        {
+            constexpr std::size_t index = compile_time::IndexOf<C, Cs...>::index();
+            static_assert((masks::include | masks::optional) & (1ul << index), "Component is not part of the query");
+            return _offsets[index] != absent;
+        }
+
+        /// @brief Gets a component of the entity, with no checks per entity.
+        /// C must either be required by the query (With<...>) or be in
+        /// Optional<...>/AnyOf<...> with has<C>() true for this chunk.
+        template <typename C>
+        auto& component(std::size_t entity) const
+        {
+            constexpr std::size_t index = compile_time::IndexOf<C, Cs...>::index();
+            static_assert((masks::include | masks::optional) & (1ul << index), "Component is not part of the query");
+            // Rows are laid out by the archetype, the alternative at this
+            // offset is always C, so don't pay for std::get's check
+            return *std::get_if<C>(&_data[entity * _stride + _offsets[index]].second);
+        }
+
+        /// @brief Gets a component from Optional<...> or AnyOf<...>,
+        /// nullptr if this archetype does not have it. Checks has<C>() on
+        /// every call, hot loops should check it once and use component<C>()
+        template <typename C>
+        auto* optional(std::size_t entity) const
+        {
+            return has<C>() ? &component<C>(entity) : nullptr;
+        }
+
+    private:
+        std::span<Row> _data;
+        Bitmask _archetype;
+        std::size_t _stride;
+        std::array<std::ptrdiff_t, sizeof...(Cs)> _offsets;
+    };
+
+    /// @brief Immutable copy of the registry components, taken when the
+    /// simulation thread called Registry::publish_snapshot()
+    template <typename... Cs>
+    class Snapshot
+    {
+    public:
+        using row_t = EntityComponentPair<Cs...>;
+
+        /// @brief The number of snapshots published up to this one,
+        /// 0 if nothing has been published yet
+        std::uint64_t frame() const
+        {
+            return _frame;
+        }
+
+        /// @brief The number of archetypes copied from the registry when
+        /// this snapshot was published, the rest were already up to date
+        std::size_t copied() const
+        {
+            return _copied;
+        }
+
+        /// @brief Same as Registry::query, but read-only
+        template <typename... Fs>
+        std::vector<QueryChunk<TupleTypes<Cs...>, TupleTypes<Fs...>, row_t const>> query() const
+        {
+            using masks = detail::QueryMasks<Registry<Cs...>, Fs...>;
+
+            std::vector<QueryChunk<TupleTypes<Cs...>, TupleTypes<Fs...>, row_t const>> chunks;
+            for (auto const& [archetype, rows] : _components)
+            {
+                if (masks::matches(archetype) && !rows->empty())
+                {
+                    chunks.emplace_back(std::span{*rows}, archetype);
+                }
+            }
+            return chunks;
+        }
+
+    private:
+        friend class Registry<Cs...>;
+
+        std::uint64_t _frame = 0;
+        std::size_t _copied = 0;
+
+        // Archetypes are shared with the other snapshots (and the registry)
+        // until they change, they are never modified once published
+        ankerl::unordered_dense::map<Bitmask, std::shared_ptr<std::vector<row_t> const>> _components;
+    };
+
+    /// @brief Handle for the render (or any other) thread to read the
+    /// snapshots of a registry. There is only one reader per registry, it
+    /// can be moved to the reading thread but not copied.
+    template <typename... Cs>
+    class SnapshotReader
+    {
+    public:
+        explicit SnapshotReader(detail::TripleBuffer<Snapshot<Cs...>>& buffer)
+            : _buffer{&buffer}
+        {
+        }
+
+        SnapshotReader(SnapshotReader const&) = delete;
+        SnapshotReader& operator=(SnapshotReader const&) = delete;
+
+        SnapshotReader(SnapshotReader&& other) noexcept
+            : _buffer{std::exchange(other._buffer, nullptr)}
+        {
+        }
+
+        SnapshotReader& operator=(SnapshotReader&& other) noexcept
+        {
+            _buffer = std::exchange(other._buffer, nullptr);
+            return *this;
+        }
+
+        /// @brief Gets the latest published snapshot, without taking any
+        /// locks. The reference stays valid until the next call to latest().
+        Snapshot<Cs...> const& latest()
+        {
+            Expects(_buffer);
+            return _buffer->acquire();
+        }
+
+    private:
+        detail::TripleBuffer<Snapshot<Cs...>>* _buffer;
     };
 
     // usage: EntityView<Circle, Square>(the_variant<Circle, Square, Position>...);
@@ -184,6 +530,8 @@ namespace maecs {
 
         using component_t = std::variant<Cs...>;
 
+        using row_t = EntityComponentPair<Cs...>;
+
         // Whenever we init Registry, we want to iterate over the
         // types of Cs... and store the <name, id> in the _component_ids;
         Registry() : _type_arrays{ &typeid(Cs)... }
@@ -235,7 +583,7 @@ namespace maecs {
             std::size_t const num_components = sizeof...(Ds);
             for (std::size_t i = 0; i < found->second.size(); i += num_components)
             {
-                std::span<std::pair<EntityId, std::variant<Cs...>>> view{begin(found->second) + i, num_components};
+                std::span<row_t> view{begin(found->second) + i, num_components};
                 EntityView<TupleTypes<Cs...>, TupleTypes<Ds...>> entity_view{view};
                 entity_views.push_back(entity_view);
             }
@@ -243,6 +591,58 @@ namespace maecs {
             return entity_views;
         }
 
+        /// @brief Gets all the entities matching the given filter terms,
+        /// i.e. query<With<Circle, Position>, Optional<Colour>, Without<Rect>>().
+        /// Archetypes are only tested against the query once, the matches
+        /// are cached and only new archetypes get tested on later calls.
+        /// In snapshot mode, every returned archetype is marked as modified,
+        /// use the const overload for read-only queries. Chunks must not be
+        /// kept across publish_snapshot(), writes through them after
+        /// publishing are not tracked.
+        /// @tparam ...Fs the filter terms (With, Without, Optional, AnyOf)
+        /// @return one chunk per matching, non-empty archetype
+        template <typename... Fs>
+        std::vector<QueryChunk<TupleTypes<Cs...>, TupleTypes<Fs...>, row_t>> query()
+        {
+            std::vector<QueryChunk<TupleTypes<Cs...>, TupleTypes<Fs...>, row_t>> chunks;
+            for (auto const archetype : matching_archetypes<Fs...>())
+            {
+                auto& component_entity_vector = _variant_components.find(archetype)->second;
+                if (!component_entity_vector.empty())
+                {
+                    // The chunk hands out mutable components
+                    modified(archetype);
+                    chunks.emplace_back(std::span{component_entity_vector}, archetype);
+                }
+            }
+            return chunks;
+        }
+
+        /// @brief Read-only version of query(), does not mark any archetype
+        /// as modified. Nothing is written, so this tests every archetype
+        /// against the query instead of using the query cache.
+        template <typename... Fs>
+        std::vector<QueryChunk<TupleTypes<Cs...>, TupleTypes<Fs...>, row_t const>> query() const
+        {
+            using masks = detail::QueryMasks<Registry<Cs...>, Fs...>;
+
+            std::vector<QueryChunk<TupleTypes<Cs...>, TupleTypes<Fs...>, row_t const>> chunks;
+            for (auto const archetype : _archetypes)
+            {
+                if (!masks::matches(archetype))
+                {
+                    continue;
+                }
+
+                auto const& component_entity_vector = _variant_components.find(archetype)->second;
+                if (!component_entity_vector.empty())
+                {
+                    chunks.emplace_back(std::span{component_entity_vector}, archetype);
+                }
+            }
+            return chunks;
+        }
+
         template <typename D>
         bool newest_set(EntityId ent_id, D const& component)
         {
@@ -250,15 +650,19 @@ namespace maecs {
             auto const prev_ent_bitmask = _entity_bitmask[ent_id];
             _entity_bitmask[ent_id] = prev_ent_bitmask | component_bitmask;
 
-            // TODO : If entity is new, assign it to some component
             if (prev_ent_bitmask == 0)
             {
-                _variant_components[component_bitmask] = {{ent_id, component}};
+                archetype(component_bitmask).push_back({ent_id, component});
+                modified(component_bitmask);
                 return true;
             }
 
             if (!(prev_ent_bitmask & component_bitmask))
             {
+                // Make sure the new archetype exists before looking up the
+                // previous one, inserting can move the previous vector
+                auto& new_component_vector = archetype(prev_ent_bitmask | component_bitmask);
+
                 // We should probably cache this when the entity is added,
                 // i.e. where in the vector the start of the entity is
                 auto prev_component_entities = _variant_components.find(prev_ent_bitmask);
@@ -273,19 +677,17 @@ namespace maecs {
                 // get however many other types we need
                 auto const prev_comp_count = compile_time::count_bits_set(prev_ent_bitmask);
 
-                // move previous items + the new component
-                auto& new_component_vector = _variant_components[prev_ent_bitmask | component_bitmask];
-                std::move(found, found + prev_comp_count, back_inserter(new_component_vector));
-                auto const component_index = compile_time::bits_to_left(prev_ent_bitmask, component_bitmask);
-                
-                // element needs to be inserted within the previous components, wherever
+                // move previous items + the new component, which goes wherever
                 // it's meant to be with relation to bitmask position
-                new_component_vector.insert(begin(new_component_vector) + new_component_vector.size() - prev_comp_count + component_index, {ent_id, component});
-                
+                auto const component_index = compile_time::bits_below(prev_ent_bitmask, component_bitmask);
+                std::move(found, found + component_index, back_inserter(new_component_vector));
+                new_component_vector.push_back({ent_id, component});
+                std::move(found + component_index, found + prev_comp_count, back_inserter(new_component_vector));
+
                 // Finally, remove the moved elements
-                // component_entity_vector.erase(found, found + prev_comp_count);
-                // Do we not need to call these elements?
-                
+                detail::remove_entity_row(component_entity_vector, found, prev_comp_count);
+                modified(prev_ent_bitmask);
+                modified(prev_ent_bitmask | component_bitmask);
                 return true;
             }
 
@@ -299,13 +701,168 @@ namespace maecs {
                 return ent_component_pair.first == ent_id;
             });
             Expects(found != end(component_entity_vector));
-            auto const component_index = compile_time::bits_to_left(component_bitmask, prev_ent_bitmask);
+            auto const component_index = compile_time::bits_below(prev_ent_bitmask, component_bitmask);
             auto this_component = std::next(found, component_index);
             Expects(this_component != end(component_entity_vector));
             std::get<D>(this_component->second) = component;
+            modified(prev_ent_bitmask);
             return true;
         }
 
+        /// @brief Turns on the snapshot mode, where another thread can read
+        /// an immutable copy of the components from the last published frame
+        /// while this registry keeps being modified.
+        /// Can only be called once per registry, the snapshots are triple
+        /// buffered for a single reading thread.
+        /// @return the reader to hand over to the reading thread, it is
+        /// valid for as long as this registry is alive
+        SnapshotReader<Cs...> enable_snapshots()
+        {
+            Expects(!_snapshots);
+            _snapshots = std::make_unique<detail::TripleBuffer<Snapshot<Cs...>>>();
+            return SnapshotReader<Cs...>{*_snapshots};
+        }
+
+        /// @brief Publishes the current state of the registry to the
+        /// snapshot reader, i.e. at the end of every simulation frame.
+        /// Each archetype modified since the last publish is copied once,
+        /// the copy is then shared by every snapshot until it changes again.
+        void publish_snapshot()
+        {
+            Expects(_snapshots);
+
+            auto& snapshot = _snapshots->back();
+            snapshot._frame = ++_snapshot_frame;
+            snapshot._copied = 0;
+            for (auto const archetype : _archetypes)
+            {
+                auto const version_found = _archetype_versions.find(archetype);
+                auto const version = version_found == end(_archetype_versions) ? 0 : version_found->second;
+
+                auto& published = _published[archetype];
+                if (!published.rows || published.version != version)
+                {
+                    published.rows = std::make_shared<std::vector<row_t> const>(_variant_components.find(archetype)->second);
+                    published.version = version;
+                    ++snapshot._copied;
+                }
+                snapshot._components[archetype] = published.rows;
+            }
+            _snapshots->publish();
+        }
+
+        /// @brief Registers an entity template with a fixed set of components,
+        /// to be spawned with instantiate()
+        /// @param ...components the component values every instance starts with
+        /// @return the id to pass to instantiate()
+        template <typename... Ds>
+        PrefabId register_prefab(Ds const&... components)
+        {
+            static auto constexpr prefab_bitmask = bit_mask<Ds...>();
+            static_assert(compile_time::count_bits_set(prefab_bitmask) == sizeof...(Ds), "Prefab components must be unique");
+
+            // Lay the components out in bitmask order, the same as the archetypes
+            std::vector<row_t> prefab_row{row_t{0, components}...};
+            std::sort(begin(prefab_row), end(prefab_row), [](auto const& lhs, auto const& rhs){
+                return lhs.second.index() < rhs.second.index();
+            });
+
+            _prefabs.push_back({prefab_bitmask, std::move(prefab_row)});
+            return _prefabs.size() - 1;
+        }
+
+        /// @brief Spawns *count* new entities from a registered prefab,
+        /// straight into the prefab's archetype
+        /// @return the ids of the new entities
+        std::vector<EntityId> instantiate(PrefabId prefab_id, std::size_t count)
+        {
+            Expects(prefab_id < _prefabs.size());
+            auto const& prefab = _prefabs[prefab_id];
+            return instantiate_row(prefab.row, prefab.bitmask, count);
+        }
+
+        /// @brief Spawns *count* new entities with copies of all the
+        /// components of an existing entity
+        /// @return the ids of the new entities
+        std::vector<EntityId> clone(EntityId ent_id, std::size_t count)
+        {
+            auto const ent_bitmask = _entity_bitmask.find(ent_id);
+            Expects(ent_bitmask != end(_entity_bitmask) && ent_bitmask->second != 0);
+
+            auto const& component_entity_vector = _variant_components.find(ent_bitmask->second)->second;
+            auto found = std::find_if(begin(component_entity_vector), end(component_entity_vector), [=](auto const& ent_component_pair){
+                return ent_component_pair.first == ent_id;
+            });
+            Expects(found != end(component_entity_vector));
+
+            // Copy the row out first, the archetype vector is about to grow
+            std::vector<row_t> entity_row{found, found + compile_time::count_bits_set(ent_bitmask->second)};
+            return instantiate_row(entity_row, ent_bitmask->second, count);
+        }
+
+        /// @brief Makes this registry hand out its own entity ids, starting
+        /// at *first_id*, instead of the global generate_entity_id(). Lets
+        /// registries on different threads create entities without sharing
+        /// a counter, as long as their id ranges don't overlap.
+        void use_local_ids(EntityId first_id)
+        {
+            _local_id = first_id;
+        }
+
+        /// @brief Gets a new entity id, from the local range if this
+        /// registry has one. Ids already used in this registry (i.e. picked
+        /// by hand for newest_set) are skipped.
+        EntityId new_entity_id()
+        {
+            EntityId ent_id;
+            do
+            {
+                ent_id = _local_id ? (*_local_id)++ : generate_entity_id();
+            } while (_entity_bitmask.contains(ent_id));
+            return ent_id;
+        }
+
+        /// @brief Removes an entity from this registry, moving its components
+        /// to the back of *entity_rows* (i.e. to insert it in another registry)
+        /// @return the bitmask of the entity, 0 if it is not in this registry
+        Bitmask extract_entity(EntityId ent_id, std::vector<row_t>& entity_rows)
+        {
+            auto const ent_bitmask_found = _entity_bitmask.find(ent_id);
+            if (ent_bitmask_found == end(_entity_bitmask) || ent_bitmask_found->second == 0)
+            {
+                return 0;
+            }
+            auto const ent_bitmask = ent_bitmask_found->second;
+            _entity_bitmask.erase(ent_bitmask_found);
+
+            auto& component_entity_vector = _variant_components.find(ent_bitmask)->second;
+            auto found = std::find_if(begin(component_entity_vector), end(component_entity_vector), [=](auto const& ent_component_pair){
+                return ent_component_pair.first == ent_id;
+            });
+            Expects(found != end(component_entity_vector));
+
+            auto const comp_count = compile_time::count_bits_set(ent_bitmask);
+            std::move(found, found + comp_count, back_inserter(entity_rows));
+            detail::remove_entity_row(component_entity_vector, found, comp_count);
+            modified(ent_bitmask);
+            return ent_bitmask;
+        }
+
+        /// @brief Adds an entity taken out of another registry with
+        /// extract_entity(), keeping its id
+        void insert_entity(std::span<row_t> entity_row, Bitmask bitmask)
+        {
+            Expects(!entity_row.empty() && entity_row.size() == compile_time::count_bits_set(bitmask));
+
+            auto& ent_bitmask = _entity_bitmask[entity_row.front().first];
+            Expects(ent_bitmask == 0);
+            ent_bitmask = bitmask;
+
+            auto& component_entity_vector = archetype(bitmask);
+            std::move(begin(entity_row), end(entity_row), back_inserter(component_entity_vector));
+            modified(bitmask);
+        }
+
         template <typename C>
         C& entity_component(EntityComponent<Cs...>& component_tuple)
         {
@@ -338,6 +895,118 @@ namespace maecs {
         }
 
     private:
+        struct QueryCache
+        {
+            std::size_t archetypes_checked = 0;
+            std::vector<Bitmask> matches;
+        };
+
+        /// @brief Gets the entity rows for the archetype, creating it
+        /// (and keeping track of it for the queries) if needed
+        std::vector<row_t>& archetype(Bitmask bitmask)
+        {
+            auto [found, inserted] = _variant_components.try_emplace(bitmask);
+            if (inserted)
+            {
+                _archetypes.push_back(bitmask);
+            }
+            return found->second;
+        }
+
+        /// @brief Appends *count* copies of the entity row to its archetype,
+        /// growing the archetype vector only once
+        std::vector<EntityId> instantiate_row(std::span<row_t const> entity_row, Bitmask bitmask, std::size_t count)
+        {
+            Expects(entity_row.size() == compile_time::count_bits_set(bitmask));
+
+            std::vector<EntityId> ent_ids;
+            ent_ids.reserve(count);
+            _entity_bitmask.reserve(_entity_bitmask.size() + count);
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                auto const ent_id = new_entity_id();
+                auto const [found, inserted] = _entity_bitmask.try_emplace(ent_id, bitmask);
+                Expects(inserted);
+                ent_ids.push_back(ent_id);
+            }
+
+            auto& component_entity_vector = archetype(bitmask);
+            auto const stride = entity_row.size();
+            auto const first = component_entity_vector.size();
+
+            if constexpr (std::is_trivially_copyable_v<row_t> && std::is_default_constructible_v<row_t>)
+            {
+                // Rows are plain bytes, block copy the whole row per entity
+                component_entity_vector.resize(first + count * stride);
+                auto* const instances = component_entity_vector.data() + first;
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    auto* const instance = instances + i * stride;
+                    std::memcpy(instance, entity_row.data(), stride * sizeof(row_t));
+                    for (std::size_t j = 0; j < stride; ++j)
+                    {
+                        instance[j].first = ent_ids[i];
+                    }
+                }
+            }
+            else
+            {
+                component_entity_vector.reserve(first + count * stride);
+                for (auto const ent_id : ent_ids)
+                {
+                    for (auto const& ent_component_pair : entity_row)
+                    {
+                        component_entity_vector.push_back({ent_id, ent_component_pair.second});
+                    }
+                }
+            }
+
+            modified(bitmask);
+            return ent_ids;
+        }
+
+        /// @brief Gets the archetypes matching the query, testing only the
+        /// archetypes created since the last time it was called
+        template <typename... Fs>
+        std::vector<Bitmask> const& matching_archetypes()
+        {
+            using masks = detail::QueryMasks<Registry<Cs...>, Fs...>;
+
+            auto& cache = _query_cache[std::type_index{typeid(masks)}];
+            for (; cache.archetypes_checked < _archetypes.size(); ++cache.archetypes_checked)
+            {
+                auto const archetype = _archetypes[cache.archetypes_checked];
+                if (masks::matches(archetype))
+                {
+                    cache.matches.push_back(archetype);
+                }
+            }
+            return cache.matches;
+        }
+
+        /// @brief Marks the archetype as changed, so the next snapshot
+        /// copies it again
+        void modified(Bitmask bitmask)
+        {
+            if (_snapshots)
+            {
+                _archetype_versions[bitmask] = ++_version;
+            }
+        }
+
+        struct PublishedArchetype
+        {
+            // Version of the archetype when the rows were copied
+            std::uint64_t version = 0;
+            std::shared_ptr<std::vector<row_t> const> rows;
+        };
+
+        struct Prefab
+        {
+            Bitmask bitmask;
+            std::vector<row_t> row;
+        };
+
         // This will store the component Ids for each class given as parameter to Registry
         // the value is of type pair<ComponentId, index in variant>
         ankerl::unordered_dense::map<ComponentName, std::pair<ComponentId, std::size_t>> _component_ids;
@@ -346,7 +1015,27 @@ namespace maecs {
         ankerl::unordered_dense::map<EntityId, std::size_t> _entity_bitmask;
 
         // This is where we store all the component data
-        ankerl::unordered_dense::map<Bitmask, std::vector<std::pair<EntityId, component_t>>> _variant_components;
+        ankerl::unordered_dense::map<Bitmask, std::vector<row_t>> _variant_components;
+
+        // All the archetypes in _variant_components, in order of creation
+        std::vector<Bitmask> _archetypes;
+
+        // Archetypes matching each query type. Keyed on the type itself,
+        // hash codes are allowed to collide
+        ankerl::unordered_dense::map<std::type_index, QueryCache> _query_cache;
+
+        // Next id to hand out when this registry uses its own id range
+        std::optional<EntityId> _local_id;
+
+        // Entity templates registered with register_prefab(), indexed by PrefabId
+        std::vector<Prefab> _prefabs;
+
+        // Snapshot mode, only set once enable_snapshots() is called
+        std::unique_ptr<detail::TripleBuffer<Snapshot<Cs...>>> _snapshots;
+        ankerl::unordered_dense::map<Bitmask, std::uint64_t> _archetype_versions;
+        ankerl::unordered_dense::map<Bitmask, PublishedArchetype> _published;
+        std::uint64_t _version = 0;
+        std::uint64_t _snapshot_frame = 0;
 
         // Array to store all the type_ids in order of Components declared in variant
         std::array<std::type_info const*, sizeof...(Cs)> _type_arrays;
@@ -0,0 +1,322 @@
+#ifndef MAECS_SHARDED_REGISTRY_H
+#define MAECS_SHARDED_REGISTRY_H
+
+#include <maecs/maecs.hpp>
+
+#include <gsl/assert>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <barrier>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace maecs
+{
+    namespace detail
+    {
+        /// @brief Bounded lock-free queue for one producer and one consumer thread
+        template <typename T, std::size_t Capacity>
+        class SpscQueue
+        {
+        public:
+            static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+            /// @brief Moves the value into the queue, called by the producer thread
+            /// @return false (leaving value untouched) if the queue is full
+            bool try_push(T& value)
+            {
+                auto const tail = _tail.load(std::memory_order_relaxed);
+                if (tail - _head.load(std::memory_order_acquire) == Capacity)
+                {
+                    return false;
+                }
+
+                _slots[tail & (Capacity - 1)] = std::move(value);
+                _tail.store(tail + 1, std::memory_order_release);
+                return true;
+            }
+
+            /// @brief Takes the oldest value out of the queue, called by the consumer thread
+            std::optional<T> try_pop()
+            {
+                auto const head = _head.load(std::memory_order_relaxed);
+                if (head == _tail.load(std::memory_order_acquire))
+                {
+                    return std::nullopt;
+                }
+
+                std::optional<T> value{std::move(_slots[head & (Capacity - 1)])};
+                _head.store(head + 1, std::memory_order_release);
+                return value;
+            }
+
+        private:
+            std::array<T, Capacity> _slots;
+
+            // Keep the producer and consumer counters on separate cache lines
+            alignas(64) std::atomic<std::size_t> _head = 0;
+            alignas(64) std::atomic<std::size_t> _tail = 0;
+        };
+    }
+
+    /// @brief A world split over several registries (shards), i.e. one per
+    /// spatial region. Each shard is only ever touched by one thread at a
+    /// time, entities move between shards through lock-free queues, a
+    /// whole batch of entity rows at a time. Shard 0 is stepped on the
+    /// calling thread, every other shard has its own worker thread that
+    /// lives as long as the ShardedRegistry.
+    template <typename... Cs>
+    class ShardedRegistry
+    {
+    public:
+        using registry_t = Registry<Cs...>;
+        using row_t = typename registry_t::row_t;
+
+        /// @brief Entity ids of each shard start at shard_index << shard_id_shift
+        static constexpr std::size_t shard_id_shift = 48;
+
+        /// @brief Entities moving from one shard to another, the rows of
+        /// all the entities are stored back to back
+        struct MigrationBatch
+        {
+            std::vector<Bitmask> bitmasks;
+            std::vector<row_t> rows;
+        };
+
+        explicit ShardedRegistry(std::size_t shard_count)
+            : _shards(shard_count)
+            , _outgoing(shard_count)
+            , _errors(shard_count)
+            , _start{static_cast<std::ptrdiff_t>(shard_count)}
+            , _sent{static_cast<std::ptrdiff_t>(shard_count)}
+            , _done{static_cast<std::ptrdiff_t>(shard_count)}
+        {
+            Expects(shard_count > 0 && shard_count < (1ul << (64 - shard_id_shift)));
+
+            for (std::size_t i = 0; i < shard_count; ++i)
+            {
+                _shards[i].use_local_ids(static_cast<EntityId>(i) << shard_id_shift);
+                _outgoing[i].resize(shard_count);
+            }
+
+            _queues.reserve(shard_count * shard_count);
+            for (std::size_t i = 0; i < shard_count * shard_count; ++i)
+            {
+                _queues.push_back(std::make_unique<queue_t>());
+            }
+
+            _workers.reserve(shard_count - 1);
+            for (std::size_t i = 1; i < shard_count; ++i)
+            {
+                _workers.emplace_back([this, i]() {
+                    while (true)
+                    {
+                        _start.arrive_and_wait();
+                        if (_stopping)
+                        {
+                            return;
+                        }
+                        step_shard(i);
+                    }
+                });
+            }
+        }
+
+        ~ShardedRegistry()
+        {
+            _stopping = true;
+            _start.arrive_and_wait();
+            _workers.clear();
+        }
+
+        ShardedRegistry(ShardedRegistry const&) = delete;
+        ShardedRegistry& operator=(ShardedRegistry const&) = delete;
+
+        std::size_t size() const
+        {
+            return _shards.size();
+        }
+
+        registry_t& shard(std::size_t index)
+        {
+            Expects(index < _shards.size());
+            return _shards[index];
+        }
+
+        /// @brief The shard an entity was created in
+        static std::size_t home_shard(EntityId ent_id)
+        {
+            return static_cast<std::size_t>(ent_id >> shard_id_shift);
+        }
+
+        /// @brief Takes the entity out of shard *from* straight away and
+        /// queues it for shard *to*. Must be called from the thread
+        /// stepping shard *from*.
+        /// @return false if the entity is not in shard *from*
+        bool migrate(EntityId ent_id, std::size_t from, std::size_t to)
+        {
+            Expects(from < _shards.size() && to < _shards.size());
+            if (from == to)
+            {
+                return true;
+            }
+
+            auto& batch = _outgoing[from][to];
+            auto const bitmask = _shards[from].extract_entity(ent_id, batch.rows);
+            if (bitmask == 0)
+            {
+                return false;
+            }
+            batch.bitmasks.push_back(bitmask);
+            return true;
+        }
+
+        /// @brief Pushes the entities migrated out of shard *from* to
+        /// their target shards. Batches that don't fit in a full queue are
+        /// kept and sent on the next call.
+        void send(std::size_t from)
+        {
+            for (std::size_t to = 0; to < _shards.size(); ++to)
+            {
+                auto& batch = _outgoing[from][to];
+                if (!batch.bitmasks.empty() && queue(from, to).try_push(batch))
+                {
+                    batch = MigrationBatch{};
+                }
+            }
+        }
+
+        /// @brief Adds all the entities queued for shard *to* into it.
+        /// Must be called from the thread stepping shard *to*.
+        void receive(std::size_t to)
+        {
+            for (std::size_t from = 0; from < _shards.size(); ++from)
+            {
+                while (auto batch = queue(from, to).try_pop())
+                {
+                    std::span<row_t> rows{batch->rows};
+                    for (auto const bitmask : batch->bitmasks)
+                    {
+                        auto const comp_count = compile_time::count_bits_set(bitmask);
+                        _shards[to].insert_entity(rows.first(comp_count), bitmask);
+                        rows = rows.subspan(comp_count);
+                    }
+                }
+            }
+        }
+
+        /// @brief Steps every shard on its own thread: runs
+        /// system(shard_index, shard) and sends out the entities the system
+        /// migrated. Once every shard has sent, each shard receives its
+        /// entities, so they show up in their new shard at the end of the step.
+        /// If the system throws on any shard, the other shards still finish
+        /// the step and the first exception is rethrown afterwards.
+        template <typename System>
+        void step(System&& system)
+        {
+            _system = std::ref(system);
+            _start.arrive_and_wait();
+            step_shard(0);
+            _system = nullptr;
+
+            auto const first_error = std::find_if(begin(_errors), end(_errors), [](auto const& error){
+                return error != nullptr;
+            });
+            if (first_error != end(_errors))
+            {
+                auto const error = *first_error;
+                std::fill(begin(_errors), end(_errors), nullptr);
+                std::rethrow_exception(error);
+            }
+        }
+
+        /// @brief Same as Registry::query, over all the shards. Must not be
+        /// called while the shards are being stepped.
+        template <typename... Fs>
+        auto query()
+        {
+            decltype(_shards[0].template query<Fs...>()) chunks;
+            for (auto& shard : _shards)
+            {
+                auto shard_chunks = shard.template query<Fs...>();
+                std::move(begin(shard_chunks), end(shard_chunks), back_inserter(chunks));
+            }
+            return chunks;
+        }
+
+    private:
+        static constexpr std::size_t queue_capacity = 64;
+        using queue_t = detail::SpscQueue<MigrationBatch, queue_capacity>;
+
+        queue_t& queue(std::size_t from, std::size_t to)
+        {
+            return *_queues[from * _shards.size() + to];
+        }
+
+        /// @brief One step of one shard, every shard has to get through all
+        /// the barriers even if the system throws
+        void step_shard(std::size_t index)
+        {
+            try
+            {
+                _system(index, _shards[index]);
+                send(index);
+            }
+            catch (...)
+            {
+                _errors[index] = std::current_exception();
+            }
+
+            _sent.arrive_and_wait();
+
+            try
+            {
+                receive(index);
+            }
+            catch (...)
+            {
+                if (!_errors[index])
+                {
+                    _errors[index] = std::current_exception();
+                }
+            }
+
+            _done.arrive_and_wait();
+        }
+
+        std::vector<registry_t> _shards;
+
+        // Batches being filled by each shard, indexed [from][to]
+        std::vector<std::vector<MigrationBatch>> _outgoing;
+
+        // One queue per (from, to) shard pair, indexed from * size() + to
+        std::vector<std::unique_ptr<queue_t>> _queues;
+
+        // Exception thrown while stepping each shard, rethrown by step()
+        std::vector<std::exception_ptr> _errors;
+
+        // Reused every step: workers wait on _start for a new step, all the
+        // shards send before _sent and receive before _done
+        std::barrier<> _start;
+        std::barrier<> _sent;
+        std::barrier<> _done;
+
+        // The system of the current step, only set while stepping
+        std::function<void(std::size_t, registry_t&)> _system;
+        bool _stopping = false;
+
+        // Declared last so the workers stop before anything they use is destroyed
+        std::vector<std::jthread> _workers;
+    };
+}
+
+#endif // MAECS_SHARDED_REGISTRY_H
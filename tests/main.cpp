@@ -9,6 +9,12 @@ struct Circle
     int radius;
 };
 
+struct Position
+{
+    int x;
+    int y;
+};
+
 template <typename... Cs>
 void create_entity_with_component(maecs::Registry<Cs...>& registry)
 {
@@ -35,7 +41,33 @@ static void BenchmarkEntitySetOneComponent(benchmark::State& state) {
         create_entity_with_component(registry);
     }
 }
+
+static void BenchmarkSpawnWithSet(benchmark::State& state) {
+    for (auto _ : state) {
+        maecs::Registry<Circle, Position> registry;
+        for (std::int64_t i = 0; i < state.range(0); ++i) {
+            auto const entity_id = maecs::generate_entity_id();
+            registry.newest_set(entity_id, Circle{.center_x = 10, .center_y = 10, .radius = 50});
+            registry.newest_set(entity_id, Position{.x = 0, .y = 0});
+        }
+        benchmark::DoNotOptimize(registry);
+    }
+}
+
+static void BenchmarkSpawnWithPrefab(benchmark::State& state) {
+    for (auto _ : state) {
+        maecs::Registry<Circle, Position> registry;
+        auto const prefab = registry.register_prefab(
+            Circle{.center_x = 10, .center_y = 10, .radius = 50},
+            Position{.x = 0, .y = 0}
+        );
+        benchmark::DoNotOptimize(registry.instantiate(prefab, state.range(0)));
+    }
+}
+
 // Register the function as a benchmark
 BENCHMARK(BenchmarkEntitySetOneComponent);
+BENCHMARK(BenchmarkSpawnWithSet)->Arg(1000);
+BENCHMARK(BenchmarkSpawnWithPrefab)->Arg(1000);
 // Run the benchmark
 BENCHMARK_MAIN();
\ No newline at end of file
@@ -3,6 +3,9 @@
 // TODO : Turn this into a proper C++ module
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <thread>
+
 
 //////////////////////////////////////////////////
 // Component Classes 
@@ -84,3 +87,356 @@ TEST(RegistryTests, SetsMultipleComponents)
     ASSERT_EQ(circle_data.radius, 52);
 
 }
+
+TEST(RegistryTests, QueriesWithAndWithout)
+{
+    maecs::Registry<Rectangle, Circle, Position> registry;
+
+    registry.newest_set(0, Position{.x = 1, .y = 1});
+    registry.newest_set(0, Circle{.center_x = 0, .center_y = 0, .radius = 5});
+
+    registry.newest_set(1, Position{.x = 2, .y = 2});
+    registry.newest_set(1, Rectangle{.width = 3, .height = 4});
+
+    registry.newest_set(2, Position{.x = 3, .y = 3});
+
+    auto const chunks = registry.query<maecs::With<Position>, maecs::Without<Rectangle>>();
+
+    std::vector<std::pair<maecs::EntityId, int>> found;
+    for (auto const& chunk : chunks)
+    {
+        for (std::size_t i = 0; i < chunk.size(); ++i)
+        {
+            found.push_back({chunk.id(i), chunk.component<Position>(i).x});
+        }
+    }
+    std::sort(begin(found), end(found));
+
+    ASSERT_EQ(found.size(), 2);
+    ASSERT_EQ(found[0], (std::pair<maecs::EntityId, int>{0, 1}));
+    ASSERT_EQ(found[1], (std::pair<maecs::EntityId, int>{2, 3}));
+}
+
+TEST(RegistryTests, QueriesOptionalComponents)
+{
+    maecs::Registry<Rectangle, Circle, Position> registry;
+
+    registry.newest_set(0, Position{.x = 1, .y = 1});
+    registry.newest_set(0, Circle{.center_x = 0, .center_y = 0, .radius = 5});
+    registry.newest_set(1, Position{.x = 2, .y = 2});
+
+    std::size_t with_circle = 0;
+    std::size_t without_circle = 0;
+    for (auto const& chunk : registry.query<maecs::With<Position>, maecs::Optional<Circle>>())
+    {
+        for (std::size_t i = 0; i < chunk.size(); ++i)
+        {
+            auto const* circle = chunk.optional<Circle>(i);
+            if (circle)
+            {
+                ASSERT_EQ(chunk.id(i), 0);
+                ASSERT_EQ(circle->radius, 5);
+                ++with_circle;
+            }
+            else
+            {
+                ASSERT_EQ(chunk.id(i), 1);
+                ++without_circle;
+            }
+        }
+    }
+
+    ASSERT_EQ(with_circle, 1);
+    ASSERT_EQ(without_circle, 1);
+}
+
+TEST(RegistryTests, QueriesOptionalComponentsPerChunk)
+{
+    maecs::Registry<Rectangle, Circle, Position> registry;
+
+    registry.newest_set(0, Position{.x = 1, .y = 1});
+    registry.newest_set(0, Circle{.center_x = 0, .center_y = 0, .radius = 5});
+    registry.newest_set(1, Position{.x = 2, .y = 2});
+    registry.newest_set(2, Position{.x = 3, .y = 3});
+
+    int radius_sum = 0;
+    std::size_t without_circle = 0;
+    for (auto const& chunk : registry.query<maecs::With<Position>, maecs::Optional<Circle>>())
+    {
+        // Whether the component is there is the same for the whole chunk
+        if (chunk.has<Circle>())
+        {
+            for (std::size_t i = 0; i < chunk.size(); ++i)
+            {
+                radius_sum += chunk.component<Circle>(i).radius;
+            }
+        }
+        else
+        {
+            without_circle += chunk.size();
+        }
+    }
+
+    ASSERT_EQ(radius_sum, 5);
+    ASSERT_EQ(without_circle, 2);
+}
+
+TEST(RegistryTests, QueriesAnyOfAndSeesNewArchetypes)
+{
+    maecs::Registry<Rectangle, Circle, Position> registry;
+
+    registry.newest_set(0, Position{.x = 1, .y = 1});
+
+    auto count_entities = [&registry]() {
+        std::size_t count = 0;
+        for (auto const& chunk : registry.query<maecs::AnyOf<Rectangle, Circle>>())
+        {
+            count += chunk.size();
+        }
+        return count;
+    };
+    ASSERT_EQ(count_entities(), 0);
+
+    // Creates new archetypes after the query result was cached
+    registry.newest_set(1, Circle{.center_x = 0, .center_y = 0, .radius = 5});
+    registry.newest_set(2, Rectangle{.width = 3, .height = 4});
+    registry.newest_set(0, Rectangle{.width = 1, .height = 1});
+    ASSERT_EQ(count_entities(), 3);
+}
+
+TEST(RegistryTests, KeepsEntitiesSharingAnArchetype)
+{
+    maecs::Registry<Rectangle, Circle, Position> registry;
+
+    registry.newest_set(0, Position{.x = 1, .y = 1});
+    registry.newest_set(1, Position{.x = 2, .y = 2});
+    registry.newest_set(2, Position{.x = 3, .y = 3});
+
+    // Moving entity 0 out should leave the other two in place
+    registry.newest_set(0, Circle{.center_x = 0, .center_y = 0, .radius = 5});
+
+    auto maybe_positions = registry.newest_get<Position>();
+    ASSERT_TRUE(maybe_positions);
+    ASSERT_EQ(maybe_positions->size(), 2);
+
+    auto maybe_both = registry.newest_get<Circle, Position>();
+    ASSERT_TRUE(maybe_both);
+    ASSERT_EQ(maybe_both->size(), 1);
+    ASSERT_EQ((*maybe_both)[0].id(), 0);
+    ASSERT_EQ((*maybe_both)[0].component<Position>().x, 1);
+    ASSERT_EQ((*maybe_both)[0].component<Circle>().radius, 5);
+}
+
+TEST(RegistryTests, SnapshotDoesNotSeeLaterChanges)
+{
+    maecs::Registry<Rectangle, Circle, Position> registry;
+    auto reader = registry.enable_snapshots();
+    ASSERT_EQ(reader.latest().frame(), 0);
+
+    registry.newest_set(0, Position{.x = 1, .y = 1});
+    registry.newest_set(1, Circle{.center_x = 0, .center_y = 0, .radius = 5});
+    registry.publish_snapshot();
+
+    // Changes after publishing only show up in the next snapshot
+    registry.newest_set(0, Position{.x = 2, .y = 2});
+    registry.newest_set(2, Position{.x = 3, .y = 3});
+
+    auto const& snapshot = reader.latest();
+    ASSERT_EQ(snapshot.frame(), 1);
+
+    auto const chunks = snapshot.query<maecs::With<Position>>();
+    ASSERT_EQ(chunks.size(), 1);
+    ASSERT_EQ(chunks[0].size(), 1);
+    ASSERT_EQ(chunks[0].id(0), 0);
+    ASSERT_EQ(chunks[0].component<Position>(0).x, 1);
+
+    registry.publish_snapshot();
+    auto const& next_snapshot = reader.latest();
+    ASSERT_EQ(next_snapshot.frame(), 2);
+
+    std::size_t positions = 0;
+    for (auto const& chunk : next_snapshot.query<maecs::With<Position>>())
+    {
+        positions += chunk.size();
+    }
+    ASSERT_EQ(positions, 2);
+    ASSERT_EQ(next_snapshot.query<maecs::With<Circle>>()[0].component<Circle>(0).radius, 5);
+}
+
+TEST(RegistryTests, SnapshotReadFromAnotherThread)
+{
+    maecs::Registry<Rectangle, Circle, Position> registry;
+    auto reader = registry.enable_snapshots();
+
+    constexpr maecs::EntityId num_entities = 64;
+    constexpr int num_frames = 2000;
+    for (maecs::EntityId id = 0; id < num_entities; ++id)
+    {
+        registry.newest_set(id, Position{.x = 0, .y = 0});
+    }
+    registry.newest_set(num_entities, Circle{.center_x = 0, .center_y = 0, .radius = 1});
+    registry.publish_snapshot();
+
+    std::atomic<bool> done = false;
+    std::atomic<bool> consistent = true;
+    std::thread render_thread{[&]() {
+        std::uint64_t last_frame = 0;
+        while (!done)
+        {
+            auto const& snapshot = reader.latest();
+            if (snapshot.frame() < last_frame)
+            {
+                consistent = false;
+            }
+            last_frame = snapshot.frame();
+
+            // Every entity should have been written in the same frame
+            for (auto const& chunk : snapshot.query<maecs::With<Position>>())
+            {
+                for (std::size_t i = 0; i < chunk.size(); ++i)
+                {
+                    auto const& position = chunk.component<Position>(i);
+                    if (position.x != static_cast<int>(snapshot.frame()) - 1 || position.y != position.x)
+                    {
+                        consistent = false;
+                    }
+                }
+            }
+        }
+    }};
+
+    for (int frame = 1; frame < num_frames; ++frame)
+    {
+        for (auto const& chunk : registry.query<maecs::With<Position>>())
+        {
+            for (std::size_t i = 0; i < chunk.size(); ++i)
+            {
+                chunk.component<Position>(i) = Position{.x = frame, .y = frame};
+            }
+        }
+        registry.publish_snapshot();
+    }
+    done = true;
+    render_thread.join();
+
+    ASSERT_TRUE(consistent);
+    ASSERT_EQ(reader.latest().frame(), num_frames);
+}
+
+TEST(RegistryTests, InstantiatesPrefab)
+{
+    maecs::Registry<Rectangle, Circle, Position> registry;
+    registry.newest_set(100, Position{.x = -1, .y = -1});
+    registry.newest_set(100, Circle{.center_x = 0, .center_y = 0, .radius = 1});
+
+    // Components given out of bitmask order on purpose
+    auto const enemy = registry.register_prefab(
+        Position{.x = 7, .y = 8},
+        Circle{.center_x = 1, .center_y = 2, .radius = 3}
+    );
+
+    auto const ent_ids = registry.instantiate(enemy, 10);
+    ASSERT_EQ(ent_ids.size(), 10);
+
+    auto maybe_entities = registry.newest_get<Circle, Position>();
+    ASSERT_TRUE(maybe_entities);
+    ASSERT_EQ(maybe_entities->size(), 11);
+
+    for (std::size_t i = 0; i < ent_ids.size(); ++i)
+    {
+        auto const& entity_view = (*maybe_entities)[i + 1];
+        ASSERT_EQ(entity_view.id(), ent_ids[i]);
+        ASSERT_EQ(entity_view.component<Position>().x, 7);
+        ASSERT_EQ(entity_view.component<Position>().y, 8);
+        ASSERT_EQ(entity_view.component<Circle>().radius, 3);
+    }
+
+    // Instances are normal entities from now on
+    registry.newest_set(ent_ids[3], Rectangle{.width = 4, .height = 5});
+    ASSERT_EQ((registry.newest_get<Circle, Position>()->size()), 10);
+    ASSERT_EQ((registry.newest_get<Rectangle, Circle, Position>()->size()), 1);
+}
+
+TEST(RegistryTests, ClonesEntity)
+{
+    maecs::Registry<Rectangle, Circle, Position> registry;
+    auto const source_id = maecs::generate_entity_id();
+    registry.newest_set(source_id, Rectangle{.width = 4, .height = 5});
+    registry.newest_set(source_id, Position{.x = 1, .y = 2});
+
+    auto const ent_ids = registry.clone(source_id, 3);
+    ASSERT_EQ(ent_ids.size(), 3);
+    for (auto const ent_id : ent_ids)
+    {
+        ASSERT_NE(ent_id, source_id);
+    }
+
+    auto const chunks = registry.query<maecs::With<Rectangle, Position>>();
+    ASSERT_EQ(chunks.size(), 1);
+    ASSERT_EQ(chunks[0].size(), 4);
+    ASSERT_EQ(chunks[0].id(0), source_id);
+    for (std::size_t i = 0; i < ent_ids.size(); ++i)
+    {
+        ASSERT_EQ(chunks[0].id(i + 1), ent_ids[i]);
+        ASSERT_EQ(chunks[0].component<Rectangle>(i + 1).height, 5);
+        ASSERT_EQ(chunks[0].component<Position>(i + 1).y, 2);
+    }
+}
+
+TEST(RegistryTests, CloneSkipsIdsInUse)
+{
+    maecs::Registry<Rectangle, Circle, Position> registry;
+
+    // Pick by hand the ids the global counter is about to hand out
+    auto const next_id = maecs::generate_entity_id() + 1;
+    registry.newest_set(next_id, Position{.x = 1, .y = 1});
+    registry.newest_set(next_id + 1, Position{.x = 2, .y = 2});
+
+    auto ent_ids = registry.clone(next_id, 2);
+    ASSERT_EQ(ent_ids.size(), 2);
+    ent_ids.push_back(next_id);
+    ent_ids.push_back(next_id + 1);
+    std::sort(begin(ent_ids), end(ent_ids));
+    ASSERT_EQ(std::unique(begin(ent_ids), end(ent_ids)), end(ent_ids));
+
+    auto const chunks = registry.query<maecs::With<Position>>();
+    ASSERT_EQ(chunks.size(), 1);
+    ASSERT_EQ(chunks[0].size(), 4);
+}
+
+TEST(RegistryTests, SnapshotOnlyCopiesChangedArchetypes)
+{
+    maecs::Registry<Rectangle, Circle, Position> registry;
+    auto reader = registry.enable_snapshots();
+
+    registry.newest_set(0, Position{.x = 1, .y = 1});
+    registry.newest_set(1, Circle{.center_x = 0, .center_y = 0, .radius = 5});
+
+    registry.publish_snapshot();
+    ASSERT_EQ(reader.latest().copied(), 2);
+
+    // Unchanged archetypes are shared by every snapshot buffer
+    for (int i = 0; i < 3; ++i)
+    {
+        registry.publish_snapshot();
+        ASSERT_EQ(reader.latest().copied(), 0);
+    }
+
+    // Read-only queries don't count as modifying
+    ASSERT_EQ(std::as_const(registry).query<maecs::With<Position>>()[0].component<Position>(0).x, 1);
+    registry.publish_snapshot();
+    ASSERT_EQ(reader.latest().copied(), 0);
+
+    // A changed archetype is copied once, then shared again
+    registry.newest_set(0, Position{.x = 2, .y = 2});
+    registry.publish_snapshot();
+    ASSERT_EQ(reader.latest().copied(), 1);
+    for (int i = 0; i < 3; ++i)
+    {
+        registry.publish_snapshot();
+        auto const& snapshot = reader.latest();
+        ASSERT_EQ(snapshot.copied(), 0);
+        ASSERT_EQ(snapshot.query<maecs::With<Position>>()[0].component<Position>(0).x, 2);
+        ASSERT_EQ(snapshot.query<maecs::With<Circle>>()[0].component<Circle>(0).radius, 5);
+    }
+}
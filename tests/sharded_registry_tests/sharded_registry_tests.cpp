@@ -0,0 +1,168 @@
+#include <maecs/sharded_registry.hpp>
+
+// TODO : Turn this into a proper C++ module
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+
+//////////////////////////////////////////////////
+// Component Classes 
+//////////////////////////////////////////////////
+struct Circle
+{
+    int center_x;
+    int center_y;
+    int radius;
+};
+
+struct Position
+{
+    int x;
+    int y;
+};
+
+using ShardedRegistry = maecs::ShardedRegistry<Circle, Position>;
+
+std::size_t count_entities(ShardedRegistry::registry_t& registry)
+{
+    std::size_t count = 0;
+    for (auto const& chunk : registry.query<maecs::With<Position>>())
+    {
+        count += chunk.size();
+    }
+    return count;
+}
+
+TEST(ShardedRegistryTests, ShardsGenerateSeparateIds)
+{
+    ShardedRegistry world{3};
+    auto const prefab0 = world.shard(0).register_prefab(Position{.x = 0, .y = 0});
+    auto const prefab2 = world.shard(2).register_prefab(Position{.x = 0, .y = 0});
+
+    auto const ids0 = world.shard(0).instantiate(prefab0, 5);
+    auto const ids2 = world.shard(2).instantiate(prefab2, 5);
+
+    for (auto const id : ids0)
+    {
+        ASSERT_EQ(ShardedRegistry::home_shard(id), 0);
+    }
+    for (auto const id : ids2)
+    {
+        ASSERT_EQ(ShardedRegistry::home_shard(id), 2);
+    }
+}
+
+TEST(ShardedRegistryTests, MigratesEntityRows)
+{
+    ShardedRegistry world{2};
+
+    auto const ent_id = world.shard(0).new_entity_id();
+    world.shard(0).newest_set(ent_id, Position{.x = 3, .y = 4});
+    world.shard(0).newest_set(ent_id, Circle{.center_x = 0, .center_y = 0, .radius = 9});
+
+    ASSERT_TRUE(world.migrate(ent_id, 0, 1));
+    ASSERT_FALSE(world.migrate(ent_id, 0, 1));
+    ASSERT_EQ(count_entities(world.shard(0)), 0);
+
+    world.send(0);
+    world.receive(1);
+
+    auto const chunks = world.shard(1).query<maecs::With<Circle, Position>>();
+    ASSERT_EQ(chunks.size(), 1);
+    ASSERT_EQ(chunks[0].size(), 1);
+    ASSERT_EQ(chunks[0].id(0), ent_id);
+    ASSERT_EQ(chunks[0].component<Position>(0).y, 4);
+    ASSERT_EQ(chunks[0].component<Circle>(0).radius, 9);
+
+    // The migrated entity can still be changed in its new shard
+    world.shard(1).newest_set(ent_id, Position{.x = 5, .y = 6});
+    ASSERT_EQ(world.shard(1).query<maecs::With<Position>>()[0].component<Position>(0).x, 5);
+}
+
+TEST(ShardedRegistryTests, StepsShardsInParallel)
+{
+    constexpr std::size_t shard_count = 4;
+    constexpr std::size_t entities_per_shard = 100;
+    constexpr int steps = 20;
+    ShardedRegistry world{shard_count};
+
+    for (std::size_t i = 0; i < shard_count; ++i)
+    {
+        auto const prefab = world.shard(i).register_prefab(Position{.x = 0, .y = static_cast<int>(i)});
+        world.shard(i).instantiate(prefab, entities_per_shard);
+    }
+
+    // Every step each entity moves one unit along x, and every entity
+    // past the shard boundary moves over to the next shard
+    for (int step = 0; step < steps; ++step)
+    {
+        world.step([&world](std::size_t index, ShardedRegistry::registry_t& shard) {
+            std::vector<maecs::EntityId> leaving;
+            for (auto const& chunk : shard.query<maecs::With<Position>>())
+            {
+                for (std::size_t i = 0; i < chunk.size(); ++i)
+                {
+                    auto& position = chunk.component<Position>(i);
+                    position.x += 1;
+                    if (chunk.id(i) % 2 == 0)
+                    {
+                        leaving.push_back(chunk.id(i));
+                    }
+                }
+            }
+
+            for (auto const ent_id : leaving)
+            {
+                world.migrate(ent_id, index, (index + 1) % shard_count);
+            }
+        });
+    }
+    std::size_t total = 0;
+    std::vector<maecs::EntityId> ids;
+    for (auto const& chunk : world.query<maecs::With<Position>>())
+    {
+        for (std::size_t i = 0; i < chunk.size(); ++i)
+        {
+            ASSERT_EQ(chunk.component<Position>(i).x, steps);
+            ids.push_back(chunk.id(i));
+        }
+        total += chunk.size();
+    }
+    ASSERT_EQ(total, shard_count * entities_per_shard);
+
+    std::sort(begin(ids), end(ids));
+    ASSERT_EQ(std::unique(begin(ids), end(ids)), end(ids));
+}
+
+TEST(ShardedRegistryTests, RethrowsSystemExceptions)
+{
+    ShardedRegistry world{3};
+    auto const ent_id = world.shard(1).new_entity_id();
+    world.shard(1).newest_set(ent_id, Position{.x = 0, .y = 0});
+
+    // Throwing on the calling thread (shard 0) or a worker must not hang,
+    // and the other shards still finish their step
+    for (std::size_t throwing_shard : {0, 2})
+    {
+        ASSERT_THROW(world.step([&world, ent_id, throwing_shard](std::size_t index, ShardedRegistry::registry_t&) {
+            if (index == throwing_shard)
+            {
+                throw std::runtime_error{"system failed"};
+            }
+            if (index == 1)
+            {
+                world.migrate(ent_id, 1, 0);
+            }
+        }), std::runtime_error);
+    }
+    ASSERT_EQ(count_entities(world.shard(0)), 1);
+
+    // The world keeps working after an exception
+    std::atomic<std::size_t> stepped = 0;
+    world.step([&stepped](std::size_t, ShardedRegistry::registry_t&) { ++stepped; });
+    ASSERT_EQ(stepped, 3);
+}